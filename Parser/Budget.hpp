@@ -0,0 +1,168 @@
+/*
+MIT License
+
+Copyright (c) 2024 LordofCreepers
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include "Exceptions.hpp"
+
+// Budgets. Limits on resources a single call of the engine may use, so that pathological
+// expressions are aborted instead of stalling whoever parses them
+
+namespace Parser
+{
+	struct Budget
+	{
+		// Maximum amount of tokens 'Tokenize' may produce. 0 means no limit
+		size_t MaxTokens = 0;
+		// Maximum depth of a tree 'Parse' may build and 'Backpatch' may walk. 0 means no limit
+		size_t MaxDepth = 0;
+		// Maximum amount of nodes 'Parse' may build. 0 means no limit
+		size_t MaxNodes = 0;
+		// Maximum amount of memory a call may have charged at once. 0 means no limit.
+		// Charged are nodes and tokens created with 'Engine::MakeShared', for as long as they're alive,
+		// plus growth of the token array and child node arrays, up until the call ends,
+		// plus split points, for as long as 'SubParse' works through them.
+		// Arrays outlive the call, but stop being charged when it ends
+		size_t MaxBytes = 0;
+		// Point in time past which calls are aborted. 'time_point::max()' means no deadline
+		std::chrono::steady_clock::time_point Deadline = std::chrono::steady_clock::time_point::max();
+	};
+
+	// Keeps count of bytes in use by allocations charged to it and refuses the ones that go over it's limit.
+	// Every allocation is also charged to the parent account, if there's one, which allows, for instance,
+	// limiting every call on it's own and all calls on behalf of a tenant at the same time
+	class MemoryAccount
+	{
+	protected:
+		std::shared_ptr<MemoryAccount> Parent;
+		// Maximum amount of bytes in use. 0 means no limit
+		size_t Limit;
+		std::atomic<size_t> Used;
+	public:
+		MemoryAccount(size_t limit = 0, std::shared_ptr<MemoryAccount> parent = nullptr) : 
+			Parent(std::move(parent)), Limit(limit), Used(0) {};
+		virtual ~MemoryAccount() = default;
+
+		/// <summary>
+		/// Charges an allocation to this account and it's parents
+		/// </summary>
+		/// <param name="bytes">- size of the allocation</param>
+		virtual void Allocate(size_t bytes)
+		{
+			size_t used = Used.fetch_add(bytes) + bytes;
+			if (Limit && used > Limit)
+			{
+				Used.fetch_sub(bytes);
+				throw MemoryLimitExceeded(Limit);
+			}
+
+			if (!Parent) return;
+
+			try
+			{
+				Parent->Allocate(bytes);
+			}
+			catch (...)
+			{
+				Used.fetch_sub(bytes);
+				throw;
+			}
+		}
+
+		/// <summary>
+		/// Returns bytes of a freed allocation to this account and it's parents
+		/// </summary>
+		/// <param name="bytes">- size of the allocation</param>
+		virtual void Deallocate(size_t bytes)
+		{
+			Used.fetch_sub(bytes);
+			if (Parent) Parent->Deallocate(bytes);
+		}
+
+		/// <summary>
+		/// Amount of bytes currently charged: live allocations made through the account plus
+		/// whatever running calls charged for containers they grow (see 'Budget::MaxBytes')
+		/// </summary>
+		/// <returns>Amount of bytes charged</returns>
+		virtual size_t GetUsed() const
+		{
+			return Used.load();
+		}
+
+		virtual size_t GetLimit() const
+		{
+			return Limit;
+		}
+	};
+
+	// Standard allocator that charges everything it allocates to a memory account.
+	// Holds the account alive for as long as anything allocated through it is
+	template<typename T>
+	struct AccountedAllocator
+	{
+		using value_type = T;
+
+		std::shared_ptr<MemoryAccount> Account;
+
+		AccountedAllocator(std::shared_ptr<MemoryAccount> account) : Account(std::move(account)) {};
+		template<typename U>
+		AccountedAllocator(const AccountedAllocator<U>& other) : Account(other.Account) {};
+
+		T* allocate(size_t count)
+		{
+			Account->Allocate(count * sizeof(T));
+
+			try
+			{
+				return std::allocator<T>().allocate(count);
+			}
+			catch (...)
+			{
+				Account->Deallocate(count * sizeof(T));
+				throw;
+			}
+		}
+
+		void deallocate(T* ptr, size_t count)
+		{
+			std::allocator<T>().deallocate(ptr, count);
+			Account->Deallocate(count * sizeof(T));
+		}
+
+		template<typename U>
+		bool operator==(const AccountedAllocator<U>& other) const
+		{
+			return Account == other.Account;
+		}
+
+		template<typename U>
+		bool operator!=(const AccountedAllocator<U>& other) const
+		{
+			return Account != other.Account;
+		}
+	};
+};
\ No newline at end of file
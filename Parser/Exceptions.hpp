@@ -58,6 +58,78 @@ public:
 	}
 };
 
+// Basic exception for expressions that exceeded one of engine's budgets
+class BudgetExceeded : public ExpressionError
+{};
+
+// Basic exception for budgets that limit amount of something
+class LimitExceeded : public BudgetExceeded
+{
+protected:
+	// The limit that was exceeded
+	size_t Limit;
+public:
+	LimitExceeded(size_t limit) : Limit(limit) {};
+
+	virtual size_t GetLimit() const
+	{
+		return Limit;
+	}
+};
+
+class TokenLimitExceeded : public LimitExceeded
+{
+public:
+	TokenLimitExceeded(size_t limit) : LimitExceeded(limit) {};
+
+	virtual const char* what() const noexcept override
+	{
+		return "Token limit exceeded";
+	}
+};
+
+class DepthLimitExceeded : public LimitExceeded
+{
+public:
+	DepthLimitExceeded(size_t limit) : LimitExceeded(limit) {};
+
+	virtual const char* what() const noexcept override
+	{
+		return "Depth limit exceeded";
+	}
+};
+
+class NodeLimitExceeded : public LimitExceeded
+{
+public:
+	NodeLimitExceeded(size_t limit) : LimitExceeded(limit) {};
+
+	virtual const char* what() const noexcept override
+	{
+		return "Node limit exceeded";
+	}
+};
+
+class MemoryLimitExceeded : public LimitExceeded
+{
+public:
+	MemoryLimitExceeded(size_t limit) : LimitExceeded(limit) {};
+
+	virtual const char* what() const noexcept override
+	{
+		return "Memory limit exceeded";
+	}
+};
+
+class DeadlineExceeded : public BudgetExceeded
+{
+public:
+	virtual const char* what() const noexcept override
+	{
+		return "Deadline exceeded";
+	}
+};
+
 // OBSOLETE
 /* class StringificationError : public ExpressionError
 {};
@@ -25,15 +25,55 @@ SOFTWARE.
 #include "Parser.hpp"
 #include "Exceptions.hpp"
 
+thread_local Parser::Engine::CallContext* Parser::Engine::CurrentCall = nullptr;
+
+Parser::Engine::CallContext::CallContext(const Engine& engine) :
+	Limits(engine.Limits),
+	HasDeadline(engine.Limits.Deadline != std::chrono::steady_clock::time_point::max())
+{
+	// Don't even start if deadline had already passed
+	if (HasDeadline) ReadClock();
+
+	// Every call gets a fresh account, so that limit applies to allocations of this call alone
+	if (Limits.MaxBytes || engine.Memory)
+		Account = std::make_shared<MemoryAccount>(Limits.MaxBytes, engine.Memory);
+
+	Previous = CurrentCall;
+	CurrentCall = this;
+}
+
+Parser::Engine::CallContext::~CallContext()
+{
+	CurrentCall = Previous;
+
+	if (Account && ChargedBytes) Account->Deallocate(ChargedBytes);
+}
+
+void Parser::Engine::CallContext::ReadClock()
+{
+	DeadlineTicks = 0;
+
+	if (std::chrono::steady_clock::now() > Limits.Deadline) throw DeadlineExceeded();
+}
+
 void Parser::Engine::SubParse(
 	View<std::vector<TokenPtr>> tokens, 
 	Tree<TokenPtr>::NodePtr& ast_node
 ) {
+	CallContext& context = *CurrentCall;
+
+	// Checked before anything else, as tokens may split expression into any amount of empty ranges.
+	// This is the only check in this call: the scan below is bounded by the range, so the range
+	// is counted as work up front and the hot loop is left without any checks
+	context.CheckDeadline(1 + (tokens.End - tokens.Start));
+
 	// If the range is empty, bail out
 	// This usually means that expression had already been parsed
 	if (tokens.Start == tokens.End) return;
 
-	// 
+	const Budget& limits = context.Limits;
+	if (limits.MaxDepth && context.Depth >= limits.MaxDepth) throw DepthLimitExceeded(limits.MaxDepth);
+	if (limits.MaxNodes && context.NodeCount >= limits.MaxNodes) throw NodeLimitExceeded(limits.MaxNodes);
 
 	// Token that is the least precident over all other token (a.k.a., should be at the top of current subtree)
 	std::vector<TokenPtr>::const_iterator smallest_precedence_token = tokens.End;
@@ -55,29 +95,93 @@ void Parser::Engine::SubParse(
 	const TokenPtr& token_ptr = *smallest_precedence_token;
 
 	// Makes found token a new child node of current subtree
-	auto child_node = std::make_shared<Tree<TokenPtr>::Node>();
+	auto child_node = MakeShared<Tree<TokenPtr>::Node>();
+	context.NodeCount++;
 	child_node->Parent = ast_node;
 	child_node->Value = token_ptr;
 
+	context.Charge(sizeof(Tree<TokenPtr>::NodePtr));
 	ast_node->Children.push_back(child_node);
 
 	// Now token is let to determine what it's children in expression can be
 	std::vector<View<std::vector<TokenPtr>>> partitions;
 	token_ptr->SplitPoints(tokens, smallest_precedence_token, partitions);
+	const size_t partitions_bytes = partitions.size() * sizeof(View<std::vector<TokenPtr>>);
+	context.Charge(partitions_bytes);
+
+	// Nodes are formed in the same order 'SubBackpatch' visits them, so, while every node so far
+	// was backpatchable during parsing, this one can be backpatched right away.
+	// It's done after 'SplitPoints', as that's the order separate passes would run them in
+	if (context.FusedTree && !context.FusedTreeDeferred)
+	{
+		// The very first node formed is the root. 'Parse' only promotes it once parsing is done,
+		// so do it early for the token to see the tree the same way 'Backpatch' would
+		if (!context.FusedTree->Root)
+		{
+			context.FusedTree->Root = child_node;
+			child_node->Parent.reset();
+		}
+
+		if (token_ptr->IsTreeBackpatchLocal())
+		{
+			token_ptr->Backpatch(*context.FusedTree, *child_node);
+			context.FusedNodeCount++;
+		}
+		else
+			context.FusedTreeDeferred = true;
+	}
 
 	// Recurrently parse subranges provided by found token
+	context.Depth++;
 	for (const View<std::vector<TokenPtr>>& par_range : partitions)
 		SubParse(par_range, child_node);
+	context.Depth--;
+
+	// Split points are freed as soon as this returns
+	context.Release(partitions_bytes);
 }
 
 void Parser::Engine::SubBackpatch(Tree<TokenPtr>& tree, Tree<TokenPtr>::NodePtr cur_node)
 {
+	CallContext& context = *CurrentCall;
+
+	const Budget& limits = context.Limits;
+	if (limits.MaxDepth && context.Depth >= limits.MaxDepth) throw DepthLimitExceeded(limits.MaxDepth);
+	context.CheckDeadline();
+
 	// Delegates backpatching to the token itself
 	cur_node->Value->Backpatch(tree, *cur_node);
 
 	// Backpatches all the child nodes in the tree
+	context.Depth++;
 	for (Tree<TokenPtr>::NodePtr child_node : cur_node->Children)
 		SubBackpatch(tree, child_node);
+	context.Depth--;
+}
+
+void Parser::Engine::ResumeBackpatch(
+	Tree<TokenPtr>& tree, 
+	Tree<TokenPtr>::NodePtr cur_node, 
+	size_t& skip_count
+) {
+	CallContext& context = *CurrentCall;
+
+	context.CheckDeadline();
+
+	// Nothing left to skip - backpatch the rest of this subtree as usual
+	if (skip_count == 0)
+	{
+		SubBackpatch(tree, cur_node);
+		return;
+	}
+
+	// This node was backpatched during parsing
+	skip_count--;
+
+	context.Depth++;
+	for (Tree<TokenPtr>::NodePtr child_node : cur_node->Children)
+		ResumeBackpatch(tree, child_node, skip_count);
+	context.Depth--;
 }
 
 void Parser::Engine::Tokenize(
@@ -85,52 +189,115 @@ void Parser::Engine::Tokenize(
 	const std::string& in_expression, 
 	std::vector<TokenPtr>& out_tokens
 ) {
-	// Reset output
+	// Reset output. Done first, so that a call aborted right away leaves nothing behind
 	out_tokens.clear();
 
+	CallContext context(*this);
+
 	// If provided string is empty, bail
 	if (in_expression.empty()) return;
 
-	// Initializes a 'cursor' - position in string where ends last matched token on current iteration
-	size_t token_start_pointer = 0;
-
-	// Run a loop until string is completely exhausted
-	while (token_start_pointer < in_expression.size())
+	try
 	{
-		// Whether no tokens were matched on current iteration
-		bool no_tokens_found = true;
+		// Initializes a 'cursor' - position in string where ends last matched token on current iteration
+		size_t token_start_pointer = 0;
+
+		// Amount of tokens from the start of the array that were already backpatched in fused mode
+		size_t backpatched_tokens = 0;
 
-		// Goes over every factory provided, feeds it expression and tracked cursor and sees whether any matches a token
-		for (TokenFactory factory : factories)
+		// Run a loop until string is completely exhausted
+		while (token_start_pointer < in_expression.size())
 		{
-			if (TokenPtr token = factory(in_expression, token_start_pointer))
-			{
-				no_tokens_found = false;
+			context.CheckDeadline();
+
+			// Whether no tokens were matched on current iteration
+			bool no_tokens_found = true;
 
-				// Adds generated token to output array
-				out_tokens.emplace_back(std::move(token));
-				break;
+			// Goes over every factory provided, feeds it expression and tracked cursor and sees whether any matches a token
+			for (TokenFactory factory : factories)
+			{
+				if (TokenPtr token = factory(in_expression, token_start_pointer))
+				{
+					no_tokens_found = false;
+
+					if (context.Limits.MaxTokens && out_tokens.size() >= context.Limits.MaxTokens)
+						throw TokenLimitExceeded(context.Limits.MaxTokens);
+
+					// Adds generated token to output array
+					context.Charge(sizeof(TokenPtr));
+					out_tokens.emplace_back(std::move(token));
+
+					// While every token so far was backpatched, a local token sees the same
+					// preceding tokens it would in 'Backpatch', so it can be backpatched right away
+					if (
+						FusedBackpatch &&
+						backpatched_tokens == out_tokens.size() - 1 &&
+						out_tokens.back()->IsArrayBackpatchLocal()
+					) {
+						out_tokens.back()->Backpatch(out_tokens, out_tokens.end() - 1);
+						backpatched_tokens++;
+					}
+					break;
+				}
 			}
+
+			// If current iteration did not match any token, then expression has a syntax error
+			if (no_tokens_found) throw UnexpectedToken(token_start_pointer);
 		}
 
-		// If current iteration did not match any token, then expression has a syntax error
-		if (no_tokens_found) throw UnexpectedToken(token_start_pointer);
+		if (!FusedBackpatch) return;
+
+		// Backpatches tokens that were left behind, in the same order 'Backpatch' would
+		for (
+			std::vector<TokenPtr>::iterator it = out_tokens.begin() + backpatched_tokens; 
+			it != out_tokens.end(); ++it
+		) {
+			context.CheckDeadline();
+			(*it)->Backpatch(out_tokens, it);
+		}
+	}
+	catch (const BudgetExceeded&)
+	{
+		// Tokens formed so far would keep holding memory charged to this call
+		out_tokens.clear();
+		throw;
 	}
 }
 
 void Parser::Engine::Parse(const std::vector<TokenPtr>& tokens, Tree<TokenPtr>& ast)
 {
+	// Old tree is taken out first, so that a call aborted right away leaves nothing behind
+	Tree<TokenPtr>::NodePtr old_root = std::move(ast.Root);
+
+	CallContext context(*this);
+
 	// Clear output tree
-	if (Tree<TokenPtr>::NodePtr& root_node = ast.Root)
+	if (old_root)
 	{
-		root_node->Value.reset();
-		root_node->Children.clear();
+		old_root->Value.reset();
+		old_root->Children.clear();
+		ast.Root = std::move(old_root);
 	}
 	else
-		ast.Root = std::make_shared<Tree<TokenPtr>::Node>();
+		ast.Root = MakeShared<Tree<TokenPtr>::Node>();
 
-	// Parse the entirety of token array
-	SubParse(View<std::vector<TokenPtr>>{ &tokens, tokens.cbegin(), tokens.cend() }, ast.Root);
+	try
+	{
+		if (FusedBackpatch)
+		{
+			FusedParse(tokens, ast);
+			return;
+		}
+
+		// Parse the entirety of token array
+		SubParse(View<std::vector<TokenPtr>>{ &tokens, tokens.cbegin(), tokens.cend() }, ast.Root);
+	}
+	catch (...)
+	{
+		// Half-built tree is of no use and would keep holding memory charged to this call
+		ast.Root.reset();
+		throw;
+	}
 
 	// Gets the root and checks if parsing has provided any result
 	Tree<TokenPtr>::NodePtr& root_node = ast.Root;
@@ -144,6 +311,31 @@ void Parser::Engine::Parse(const std::vector<TokenPtr>& tokens, Tree<TokenPtr>&
 	root_node = root_node->Children[0];
 }
 
+void Parser::Engine::FusedParse(const std::vector<TokenPtr>& tokens, Tree<TokenPtr>& ast)
+{
+	CallContext& context = *CurrentCall;
+
+	// Cleared root becomes a placeholder parent for the actual root.
+	// Tree is left rootless, so 'SubParse' can promote the actual root as soon as it's formed
+	Tree<TokenPtr>::NodePtr placeholder_node = ast.Root;
+	ast.Root.reset();
+
+	context.FusedTree = &ast;
+	SubParse(View<std::vector<TokenPtr>>{ &tokens, tokens.cbegin(), tokens.cend() }, placeholder_node);
+	context.FusedTree = nullptr;
+
+	// Parsing didn't provide any result. Leave the tree the same way regular parsing would
+	if (!ast.Root)
+	{
+		ast.Root = placeholder_node;
+		return;
+	}
+
+	// Backpatches nodes that were left behind, in the same order 'Backpatch' would
+	size_t skip_count = context.FusedNodeCount;
+	ResumeBackpatch(ast, ast.Root, skip_count);
+}
+
 void Parser::Engine::Stringify(const std::vector<TokenPtr>& tokens, std::string& out_string)
 {
 	// Generates a view of the entire vector, as "Stringify" operates on views
@@ -175,13 +367,24 @@ void Parser::Engine::Stringify(const Tree<TokenPtr>& token_ast, std::string& out
 
 void Parser::Engine::Backpatch(std::vector<TokenPtr>& tokens)
 {
+	CallContext context(*this);
+
 	for (std::vector<TokenPtr>::iterator it = tokens.begin(); it != tokens.end(); ++it)
+	{
+		context.CheckDeadline();
+
 		// Delegates backpatching to tokens themselves
 		(*it)->Backpatch(tokens, it);
+	}
 }
 
 void Parser::Engine::Backpatch(Tree<TokenPtr>& tree)
 {
+	CallContext context(*this);
+
+	// Can't work with empty tree
+	if (!tree.Root || !tree.Root->Value) return;
+
 	// Starts backpatching from the root
 	SubBackpatch(tree, tree.Root);
 }
\ No newline at end of file
@@ -30,6 +30,7 @@ SOFTWARE.
 #include <functional>
 #include "Tree.hpp"
 #include "View.hpp"
+#include "Budget.hpp"
 
 // Because this library used to be pure math expressions parser, expect a lot of examples to involve math
 
@@ -223,6 +224,26 @@ namespace Parser
 			Tree<TokenPtr>& tree,
 			Tree<TokenPtr>::Node& cur_node
 		) = 0;
+
+		/// <summary>
+		/// Determines whether array backpatch of this token only looks at tokens preceding it
+		/// and only modifies the token itself. Such tokens can be backpatched right as they are tokenized
+		/// (see Engine::FusedBackpatch)
+		/// </summary>
+		/// <returns>Whether this token can be backpatched during tokenization</returns>
+		virtual bool IsArrayBackpatchLocal() const { return false; }
+		/// <summary>
+		/// Determines whether tree backpatch of this token only looks at nodes backpatched before it
+		/// (it's parent nodes and everything to the left of it), never it's own child nodes,
+		/// and only modifies the token itself. Such tokens can be backpatched right as they are parsed
+		/// (see Engine::FusedBackpatch), which is while the rest of the expression is still being parsed.
+		/// Because of this, backpatch must not change anything 'IsPrecedent', 'FindNextToken' or
+		/// 'SplitPoints' read, as other tokens can still see this token through the array they're in.
+		/// If parsing is aborted, tokens backpatched so far stay backpatched, so they have to be
+		/// tokenized again before parsing is retried (unless backpatch can safely run twice)
+		/// </summary>
+		/// <returns>Whether this token can be backpatched during parsing</returns>
+		virtual bool IsTreeBackpatchLocal() const { return false; }
 	};
 
 	/* A callable object that is responsible for identifying any token at the string's cursor,
@@ -231,12 +252,102 @@ namespace Parser
 	* TokenPtr - Generated token. Should be 'nullptr' if factory didn't match any
 	* const std::string& - Expression being parsed
 	* size_t& - Cursor. If factory matches a token, it should advance this to the end of that token
+	Tokens should be created with 'Engine::MakeShared' for their memory to count towards engine's budget
 	*/
 	using TokenFactory = std::function<TokenPtr(const std::string&, size_t&)>;
 
 	class Engine
 	{
 	protected:
+		// State of a single call to the engine. It lives on the stack of that call and is reached
+		// through 'CurrentCall', so the engine can be called from several threads at once or
+		// re-entered from within a token
+		struct CallContext
+		{
+			// Tree being built by 'Parse' while fused backpatching is on, null otherwise
+			Tree<TokenPtr>* FusedTree = nullptr;
+			// Amount of nodes, in order of 'SubBackpatch', that were already backpatched during parsing
+			size_t FusedNodeCount = 0;
+			// Whether parsing has met a token that can't be backpatched during parsing.
+			// Every node after it is left for backpatching once the tree is complete
+			bool FusedTreeDeferred = false;
+
+			// Amount of deadline checks between reads of the clock
+			static const size_t DeadlineCheckInterval = 64;
+
+			// Engine's limits at the moment this call started
+			Budget Limits;
+			// Whether limits have a deadline at all
+			bool HasDeadline = false;
+			// Account allocations of this call are charged to. Null if memory isn't limited
+			std::shared_ptr<MemoryAccount> Account;
+			// Amount of nodes built by this call
+			size_t NodeCount = 0;
+			// Depth of the node currently processed by this call
+			size_t Depth = 0;
+			// Amount of deadline checks since the clock was last read
+			size_t DeadlineTicks = 0;
+			// Bytes charged to the account by 'Charge' during this call
+			size_t ChargedBytes = 0;
+			// Call this one is nested in on the same thread, if any
+			CallContext* Previous = nullptr;
+
+			/// <summary>
+			/// Starts tracking resources of a call and makes it the current call on this thread
+			/// </summary>
+			/// <param name="engine">- engine that's being called</param>
+			CallContext(const Engine& engine);
+			~CallContext();
+
+			CallContext(const CallContext&) = delete;
+			CallContext& operator=(const CallContext&) = delete;
+
+			/// <summary>
+			/// Aborts the call if deadline had passed.
+			/// Reading the clock isn't free, so it is actually read only once in a while
+			/// </summary>
+			/// <param name="work">- amount of work done since the last check, in tokens or nodes</param>
+			void CheckDeadline(size_t work = 1)
+			{
+				if (HasDeadline && (DeadlineTicks += work) >= DeadlineCheckInterval) ReadClock();
+			}
+
+			/// <summary>
+			/// Reads the clock and aborts the call if deadline had passed
+			/// </summary>
+			void ReadClock();
+
+			/// <summary>
+			/// Charges memory of containers the engine grows during this call (arrays of tokens,
+			/// child nodes and split points) to the account. Those aren't allocated through the account,
+			/// so the charge is held until it's released or the call ends, whichever comes first
+			/// </summary>
+			/// <param name="bytes">- amount of memory the container grew by</param>
+			void Charge(size_t bytes)
+			{
+				if (!Account) return;
+
+				Account->Allocate(bytes);
+				ChargedBytes += bytes;
+			}
+
+			/// <summary>
+			/// Releases memory charged by 'Charge' once the container is gone
+			/// </summary>
+			/// <param name="bytes">- amount of memory the container held</param>
+			void Release(size_t bytes)
+			{
+				if (!Account) return;
+
+				Account->Deallocate(bytes);
+				ChargedBytes -= bytes;
+			}
+		};
+
+		// Innermost call running on this thread, if any.
+		// Methods below are only ever called from within a call, so it's never null for them
+		static thread_local CallContext* CurrentCall;
+
 		/// <summary>
 		/// Parses a subexpression of token into a tree branch and attaches this branch to
 		/// provided node
@@ -257,7 +368,67 @@ namespace Parser
 			Tree<TokenPtr>& tree,
 			Tree<TokenPtr>::NodePtr cur_node
 		);
+
+		/// <summary>
+		/// Same as 'SubBackpatch', but skips first nodes that were already backpatched during parsing
+		/// </summary>
+		/// <param name="tree">- tree token resides in</param>
+		/// <param name="cur_node">- token's node in the tree</param>
+		/// <param name="skip_count">-
+		/// (in) amount of nodes to skip;
+		/// (out) amount of nodes left to skip after this subtree
+		/// </param>
+		virtual void ResumeBackpatch(
+			Tree<TokenPtr>& tree,
+			Tree<TokenPtr>::NodePtr cur_node,
+			size_t& skip_count
+		);
+
+		/// <summary>
+		/// 'Parse' with backpatching of the resulting tree fused into it
+		/// </summary>
+		/// <param name="tokens">- array of tokens</param>
+		/// <param name="out_ast">- (out) resulting abstract syntax tree</param>
+		virtual void FusedParse(const std::vector<TokenPtr>& tokens, Tree<TokenPtr>& out_ast);
 	public:
+		/// <summary>
+		/// When set, 'Tokenize' and 'Parse' also backpatch their results, same as 'Backpatch' would.
+		/// Tokens that declare their backpatch local are backpatched as soon as they're formed,
+		/// while data is still hot; the rest is backpatched afterwards.
+		/// There's no need to call 'Backpatch' after 'Tokenize' or 'Parse' in this mode.
+		/// Unlike separate passes, a 'Parse' that throws may have already backpatched some of
+		/// the tokens it was given; expression should be tokenized again before retrying
+		/// </summary>
+		bool FusedBackpatch = false;
+
+		/// <summary>
+		/// Resources every call to 'Tokenize', 'Parse' and 'Backpatch' is allowed to use.
+		/// A call that exceeds any of them is aborted with 'BudgetExceeded'
+		/// </summary>
+		Budget Limits;
+		/// <summary>
+		/// Optional account every allocation made through the engine is also charged to
+		/// (for instance, one shared by all calls on behalf of a tenant)
+		/// </summary>
+		std::shared_ptr<MemoryAccount> Memory;
+
+		/// <summary>
+		/// Creates an object, charging it's memory to the budget of the call running on this thread.
+		/// Token factories should create tokens through this for them to be accounted
+		/// </summary>
+		/// <param name="args">- arguments to object's constructor</param>
+		/// <returns>Created object</returns>
+		template<typename T, typename... Args>
+		static std::shared_ptr<T> MakeShared(Args&&... args)
+		{
+			if (!CurrentCall || !CurrentCall->Account) return std::make_shared<T>(std::forward<Args>(args)...);
+
+			return std::allocate_shared<T>(
+				AccountedAllocator<T>(CurrentCall->Account), 
+				std::forward<Args>(args)...
+			);
+		}
+
 		/// <summary>
 		/// Splits expression into array of tokens in accordance to provided token factories
 		/// </summary>
@@ -0,0 +1,253 @@
+/*
+MIT License
+
+Copyright (c) 2024 LordofCreepers
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+// Checks that engine's budgets abort calls that exceed them and leave nothing behind
+
+#include <algorithm>
+#include <iostream>
+#include <thread>
+#include "Parser/Parser.hpp"
+
+// Minimal token for expressions of the form "1+1+1...". '+' splits around itself,
+// ',' splits it's range into a lot of empty ones
+class TestToken : public Parser::IToken
+{
+public:
+	char Symbol;
+	// Optional engine to re-enter from tree backpatch
+	Parser::Engine* Nested = nullptr;
+
+	TestToken(char symbol) : Symbol(symbol) {};
+
+	virtual bool IsPrecedent(const IToken* other) const override
+	{
+		return Symbol == '1' || static_cast<const TestToken*>(other)->Symbol == ',';
+	}
+
+	virtual void FindNextToken(
+		View<std::vector<Parser::TokenPtr>> tokens_range,
+		std::vector<Parser::TokenPtr>::const_iterator& token_cursor
+	) const override
+	{
+		token_cursor++;
+	}
+
+	virtual void SplitPoints(
+		View<std::vector<Parser::TokenPtr>> tokens_range,
+		std::vector<Parser::TokenPtr>::const_iterator cur_token,
+		std::vector<View<std::vector<Parser::TokenPtr>>>& result_ranges
+	) const override
+	{
+		if (Symbol == '+')
+		{
+			result_ranges.emplace_back(tokens_range.Source, tokens_range.Start, cur_token);
+			result_ranges.emplace_back(tokens_range.Source, cur_token + 1, tokens_range.End);
+		}
+		else if (Symbol == ',')
+		{
+			// Lets the deadline pass before producing the ranges
+			std::this_thread::sleep_for(std::chrono::milliseconds(5));
+			for (size_t i = 0; i < 1000; i++)
+				result_ranges.emplace_back(tokens_range.Source, cur_token, cur_token);
+		}
+	}
+
+	virtual void Stringify(
+		View<std::vector<Parser::TokenPtr>> token_range,
+		std::vector<Parser::TokenPtr>::const_iterator cur_token,
+		std::string& out_string
+	) const override
+	{
+		out_string += Symbol;
+	}
+
+	virtual void Stringify(
+		const Tree<Parser::TokenPtr>& tree,
+		const Tree<Parser::TokenPtr>::Node& cur_node,
+		std::string& out_string
+	) const override
+	{}
+
+	virtual void Backpatch(
+		std::vector<Parser::TokenPtr>& token_range,
+		std::vector<Parser::TokenPtr>::iterator cur_token
+	) override
+	{}
+
+	virtual void Backpatch(
+		Tree<Parser::TokenPtr>& tree,
+		Tree<Parser::TokenPtr>::Node& cur_node
+	) override
+	{
+		// Re-enters the engine, which must not affect budgets of the outer call
+		if (!Nested) return;
+
+		std::vector<Parser::TokenPtr> tokens{ std::make_shared<TestToken>('1') };
+		Tree<Parser::TokenPtr> tree_nested;
+		Nested->Parse(tokens, tree_nested);
+	}
+};
+
+static const std::vector<Parser::TokenFactory> Factories{
+	[](const std::string& expression, size_t& cursor) -> Parser::TokenPtr
+	{
+		return Parser::Engine::MakeShared<TestToken>(expression[cursor++]);
+	}
+};
+
+static size_t Depth(const Tree<Parser::TokenPtr>::NodePtr& node)
+{
+	size_t depth = 0;
+	for (const Tree<Parser::TokenPtr>::NodePtr& child : node->Children)
+		depth = std::max(depth, Depth(child));
+
+	return depth + 1;
+}
+
+static int Failures = 0;
+
+static void Check(bool condition, const char* description)
+{
+	if (condition) return;
+
+	std::cerr << "Failed: " << description << "\n";
+	Failures++;
+}
+
+// Runs the call and checks that it's aborted with expected exception
+template<typename Exception, typename Call>
+static void CheckThrows(Call call, const char* description)
+{
+	try
+	{
+		call();
+	}
+	catch (const Exception&)
+	{
+		return;
+	}
+	catch (...)
+	{}
+
+	Check(false, description);
+}
+
+int main()
+{
+	std::string expression = "1";
+	for (size_t i = 0; i < 100; i++) expression += "+1";
+
+	auto tenant = std::make_shared<Parser::MemoryAccount>();
+
+	{
+		Parser::Engine engine;
+		engine.Memory = tenant;
+
+		std::vector<Parser::TokenPtr> tokens;
+		Tree<Parser::TokenPtr> tree;
+		engine.Tokenize(Factories, expression, tokens);
+		engine.Parse(tokens, tree);
+		engine.Backpatch(tree);
+
+		Check(tenant->GetUsed() > 0, "tokens and nodes are charged to the tenant");
+
+		engine.Limits.MaxTokens = 10;
+		CheckThrows<TokenLimitExceeded>(
+			[&] { engine.Tokenize(Factories, expression, tokens); }, "token limit");
+		Check(tokens.empty(), "aborted tokenization leaves no tokens");
+		engine.Limits.MaxTokens = 0;
+
+		engine.Tokenize(Factories, expression, tokens);
+
+		engine.Limits.MaxNodes = 10;
+		CheckThrows<NodeLimitExceeded>([&] { engine.Parse(tokens, tree); }, "node limit");
+		Check(!tree.Root, "aborted parsing leaves no tree");
+		engine.Limits.MaxNodes = 0;
+
+		engine.Limits.MaxBytes = 1000;
+		CheckThrows<MemoryLimitExceeded>([&] { engine.Parse(tokens, tree); }, "memory limit");
+		Check(!tree.Root, "aborted parsing leaves no tree");
+		engine.Limits.MaxBytes = 0;
+
+		engine.Limits.MaxDepth = 10;
+		CheckThrows<DepthLimitExceeded>([&] { engine.Parse(tokens, tree); }, "depth limit");
+		engine.Limits.MaxDepth = 0;
+
+		engine.Parse(tokens, tree);
+		engine.Limits.MaxDepth = 10;
+		CheckThrows<DepthLimitExceeded>([&] { engine.Backpatch(tree); }, "depth limit on backpatch");
+		engine.Limits.MaxDepth = 0;
+
+		std::vector<Parser::TokenPtr> stale_tokens;
+		engine.Tokenize(Factories, expression, stale_tokens);
+		engine.Parse(tokens, tree);
+
+		engine.Limits.Deadline = std::chrono::steady_clock::now();
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		CheckThrows<DeadlineExceeded>([&] { engine.Parse(tokens, tree); }, "passed deadline");
+		Check(!tree.Root, "call aborted on entry leaves no tree");
+		CheckThrows<DeadlineExceeded>(
+			[&] { engine.Tokenize(Factories, expression, stale_tokens); }, "passed deadline on tokenization");
+		Check(stale_tokens.empty(), "call aborted on entry leaves no tokens");
+		engine.Limits.Deadline = std::chrono::steady_clock::time_point::max();
+
+		// Nested calls on the same engine must leave outer call's depth intact.
+		// Limit is exactly the depth of the tree, so any drift of outer call's depth shows up
+		engine.Parse(tokens, tree);
+		const size_t depth = Depth(tree.Root);
+
+		Tree<Parser::TokenPtr>::NodePtr nested_node = tree.Root;
+		for (size_t i = 0; i < depth / 2; i++) nested_node = nested_node->Children[0];
+		static_cast<TestToken*>(nested_node->Value.get())->Nested = &engine;
+
+		engine.Limits.MaxDepth = depth;
+		try
+		{
+			engine.Backpatch(tree);
+		}
+		catch (const BudgetExceeded&)
+		{
+			Check(false, "nested call doesn't affect outer call's depth");
+		}
+
+		engine.Limits.MaxDepth = depth - 1;
+		CheckThrows<DepthLimitExceeded>([&] { engine.Backpatch(tree); }, "depth limit is exact");
+		engine.Limits.MaxDepth = 0;
+	}
+
+	Check(tenant->GetUsed() == 0, "tenant gets all memory back once results are gone");
+
+	{
+		// Token splitting it's range into empty ones still runs into the deadline
+		Parser::Engine engine;
+		std::vector<Parser::TokenPtr> tokens;
+		Tree<Parser::TokenPtr> tree;
+		engine.Tokenize(Factories, ",", tokens);
+
+		engine.Limits.Deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(1);
+		CheckThrows<DeadlineExceeded>([&] { engine.Parse(tokens, tree); }, "deadline on empty ranges");
+	}
+
+	return Failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,248 @@
+/*
+MIT License
+
+Copyright (c) 2024 LordofCreepers
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+// Checks that fused backpatching produces exactly what separate passes do:
+// same backpatches in the same order, same tree, same state seen by every token
+
+#include <iostream>
+#include "Parser/Parser.hpp"
+
+// Log of every backpatch made to tokens
+static std::string CallLog;
+
+// Minimal arithmetic token. Whether it's backpatch is local depends on the factory,
+// so every mix of local and non-local tokens can be checked
+class TestToken : public Parser::IToken
+{
+public:
+	char Symbol;
+	bool ArrayLocal;
+	bool TreeLocal;
+	// Optional engine to re-enter from tree backpatch
+	Parser::Engine* Nested = nullptr;
+	// Whether 'SplitPoints' was already called on this token
+	mutable bool Split = false;
+	// What this token saw while being backpatched
+	std::string Seen;
+
+	TestToken(char symbol, bool array_local, bool tree_local) :
+		Symbol(symbol), ArrayLocal(array_local), TreeLocal(tree_local) {};
+
+	int Priority() const
+	{
+		return Symbol == '+' ? 0 : Symbol == '*' ? 1 : 2;
+	}
+
+	virtual bool IsPrecedent(const IToken* other) const override
+	{
+		const int other_priority = static_cast<const TestToken*>(other)->Priority();
+		return Priority() == 2 || Priority() > other_priority;
+	}
+
+	virtual void FindNextToken(
+		View<std::vector<Parser::TokenPtr>> tokens_range,
+		std::vector<Parser::TokenPtr>::const_iterator& token_cursor
+	) const override
+	{
+		token_cursor++;
+	}
+
+	virtual void SplitPoints(
+		View<std::vector<Parser::TokenPtr>> tokens_range,
+		std::vector<Parser::TokenPtr>::const_iterator cur_token,
+		std::vector<View<std::vector<Parser::TokenPtr>>>& result_ranges
+	) const override
+	{
+		Split = true;
+
+		if (Priority() == 2) return;
+
+		result_ranges.emplace_back(tokens_range.Source, tokens_range.Start, cur_token);
+		result_ranges.emplace_back(tokens_range.Source, cur_token + 1, tokens_range.End);
+	}
+
+	virtual void Stringify(
+		View<std::vector<Parser::TokenPtr>> token_range,
+		std::vector<Parser::TokenPtr>::const_iterator cur_token,
+		std::string& out_string
+	) const override
+	{
+		out_string += Symbol;
+	}
+
+	virtual void Stringify(
+		const Tree<Parser::TokenPtr>& tree,
+		const Tree<Parser::TokenPtr>::Node& cur_node,
+		std::string& out_string
+	) const override
+	{}
+
+	virtual void Backpatch(
+		std::vector<Parser::TokenPtr>& token_range,
+		std::vector<Parser::TokenPtr>::iterator cur_token
+	) override
+	{
+		CallLog += Symbol;
+		CallLog += 'a';
+
+		Seen += 'A';
+		if (cur_token != token_range.begin())
+			Seen += static_cast<TestToken*>((cur_token - 1)->get())->Seen;
+	}
+
+	virtual void Backpatch(
+		Tree<Parser::TokenPtr>& tree,
+		Tree<Parser::TokenPtr>::Node& cur_node
+	) override
+	{
+		CallLog += Symbol;
+		CallLog += 't';
+
+		Seen += 'T';
+		Seen += Split ? 'S' : '-';
+		if (Tree<Parser::TokenPtr>::NodePtr parent = cur_node.Parent.lock())
+			Seen += static_cast<TestToken*>(parent->Value.get())->Seen;
+		Seen += tree.Root.get() == &cur_node ? 'R' : 'N';
+
+		// Re-enters the engine with an unrelated expression, which must not disturb the outer call
+		if (Nested)
+		{
+			std::vector<Parser::TokenPtr> tokens{ std::make_shared<TestToken>('9', false, false) };
+			Tree<Parser::TokenPtr> tree_nested;
+			std::string log = CallLog;
+			Nested->Parse(tokens, tree_nested);
+			CallLog = log;
+		}
+	}
+
+	virtual bool IsArrayBackpatchLocal() const override
+	{
+		return ArrayLocal;
+	}
+
+	virtual bool IsTreeBackpatchLocal() const override
+	{
+		return TreeLocal;
+	}
+};
+
+// Picks which tokens are local by the bits of the mask. Only the lower 7 bits are ever read
+static std::vector<Parser::TokenFactory> MakeFactories(unsigned mask, Parser::Engine* nested)
+{
+	return {
+		[mask, nested](const std::string& expression, size_t& cursor) -> Parser::TokenPtr
+		{
+			auto token = std::make_shared<TestToken>(
+				expression[cursor],
+				(mask >> (cursor % 5)) & 1,
+				(mask >> ((cursor + 2) % 7)) & 1
+			);
+			if (cursor % 3 == 0) token->Nested = nested;
+
+			cursor++;
+			return token;
+		}
+	};
+}
+
+static std::string Dump(const Tree<Parser::TokenPtr>::NodePtr& node)
+{
+	if (!node || !node->Value) return ".";
+
+	const TestToken* token = static_cast<const TestToken*>(node->Value.get());
+	std::string result = "(" + std::string(1, token->Symbol) + token->Seen;
+	for (const Tree<Parser::TokenPtr>::NodePtr& child : node->Children)
+		result += Dump(child);
+
+	return result + ")";
+}
+
+int main()
+{
+	const std::vector<std::string> expressions{ "", "1", "1*2", "1+2*3+4*5*6", "1+2+3*4*5+6+7*8" };
+
+	for (const std::string& expression : expressions)
+		for (unsigned mask = 0; mask < 128; mask++)
+		{
+			Parser::Engine separate;
+			Parser::Engine fused;
+			fused.FusedBackpatch = true;
+
+			std::vector<Parser::TokenPtr> separate_tokens;
+			Tree<Parser::TokenPtr> separate_tree;
+			CallLog.clear();
+			separate.Tokenize(MakeFactories(mask, &separate), expression, separate_tokens);
+			separate.Backpatch(separate_tokens);
+			separate.Parse(separate_tokens, separate_tree);
+			if (!expression.empty()) separate.Backpatch(separate_tree);
+			const std::string separate_log = CallLog;
+
+			std::vector<Parser::TokenPtr> fused_tokens;
+			Tree<Parser::TokenPtr> fused_tree;
+			CallLog.clear();
+			fused.Tokenize(MakeFactories(mask, &fused), expression, fused_tokens);
+			fused.Parse(fused_tokens, fused_tree);
+			const std::string fused_log = CallLog;
+
+			if (separate_log != fused_log || Dump(separate_tree.Root) != Dump(fused_tree.Root))
+			{
+				std::cerr << "Mismatch on \"" << expression << "\" with mask " << mask << "\n"
+					<< "separate: " << separate_log << " " << Dump(separate_tree.Root) << "\n"
+					<< "fused:    " << fused_log << " " << Dump(fused_tree.Root) << "\n";
+				return 1;
+			}
+
+			// Aborted parsing leaves tokens it had backpatched changed. Retrying from tokenization
+			// must still produce exactly what separate passes do
+			if (expression.size() < 2) continue;
+
+			fused.Tokenize(MakeFactories(mask, &fused), expression, fused_tokens);
+			fused.Limits.MaxNodes = 2;
+			try
+			{
+				fused.Parse(fused_tokens, fused_tree);
+
+				std::cerr << "Parsing of \"" << expression << "\" wasn't aborted\n";
+				return 1;
+			}
+			catch (const NodeLimitExceeded&)
+			{}
+			fused.Limits.MaxNodes = 0;
+
+			CallLog.clear();
+			fused.Tokenize(MakeFactories(mask, &fused), expression, fused_tokens);
+			fused.Parse(fused_tokens, fused_tree);
+			const std::string retry_log = CallLog;
+
+			if (separate_log != retry_log || Dump(separate_tree.Root) != Dump(fused_tree.Root))
+			{
+				std::cerr << "Mismatch on retry of \"" << expression << "\" with mask " << mask << "\n"
+					<< "separate: " << separate_log << " " << Dump(separate_tree.Root) << "\n"
+					<< "fused:    " << retry_log << " " << Dump(fused_tree.Root) << "\n";
+				return 1;
+			}
+		}
+
+	return 0;
+}